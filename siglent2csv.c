@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <math.h>
 
 #ifdef WIN32
     #include <windows.h>
@@ -22,11 +23,18 @@
 
 #define BILLION 1000000000.0
 
+// Number of min/max points in the decimated preview output.
+#define PREVIEW_POINTS 1000
+
 int input_file = -1;
 uint8_t *input_data = NULL;
 off_t input_size = -1;
 char *output_file_buffer = NULL;
 FILE *output_file = NULL;
+FILE *statistics_file = NULL;
+FILE *preview_file = NULL;
+uint8_t *preview_minimums = NULL;
+uint8_t *preview_maximums = NULL;
 
 struct ConversionTask {
     // Beginning and size of the task.
@@ -59,6 +67,18 @@ struct ConversionTask {
     int32_t ch2_on;
     int32_t ch3_on;
     int32_t ch4_on;
+    // Optional statistics and preview sinks, filled in during the same pass as the CSV output. Everything is kept as raw
+    // sample codes (indexed by enabled channel) and only converted to physical units once all tasks have finished.
+    uint8_t compute_statistics;
+    uint8_t code_minimums[4];
+    uint8_t code_maximums[4];
+    int64_t code_sums[4];
+    uint64_t code_sums_of_squares[4];
+    // Number of samples per preview point, or 0 if no preview is being generated. Tasks always start on a preview bucket
+    // boundary, so each bucket is written by exactly one task.
+    uint32_t preview_bucket_size;
+    uint8_t *preview_minimums;
+    uint8_t *preview_maximums;
 };
 
 void *conversion_thread(void *ptr) {
@@ -87,7 +107,22 @@ void *conversion_thread(void *ptr) {
     int32_t ch2_on = conversion_task->ch2_on;
     int32_t ch3_on = conversion_task->ch3_on;
     int32_t ch4_on = conversion_task->ch4_on;
-
+    uint8_t compute_statistics = conversion_task->compute_statistics;
+    uint32_t preview_bucket_size = conversion_task->preview_bucket_size;
+    uint8_t *preview_minimums = conversion_task->preview_minimums;
+    uint8_t *preview_maximums = conversion_task->preview_maximums;
+
+    uint8_t code_minimums[4] = {255, 255, 255, 255};
+    uint8_t code_maximums[4] = {0, 0, 0, 0};
+    int64_t code_sums[4] = {0, 0, 0, 0};
+    uint64_t code_sums_of_squares[4] = {0, 0, 0, 0};
+
+    uint8_t bucket_minimums[4] = {255, 255, 255, 255};
+    uint8_t bucket_maximums[4] = {0, 0, 0, 0};
+    uint32_t bucket_fill = 0;
+    uint32_t bucket_index = preview_bucket_size ? start_index / preview_bucket_size : 0;
+
+    uint8_t codes[4];
     double channel_values[4];
     double timestamp = time_offset + start_index * time_scaling_factor;
 
@@ -97,22 +132,26 @@ void *conversion_thread(void *ptr) {
         uint8_t channel_values_index = 0;
         if (ch1_on) {
             //channel_values[channel_values_index] = (ch1_data_offset[i] - 128) * ch1_scaling_factor + ch1_vert_offset;
-            channel_values[channel_values_index] = (ch1_data_offset[i] - 128) * ch1_scaling_factor;
+            codes[channel_values_index] = ch1_data_offset[i];
+            channel_values[channel_values_index] = (codes[channel_values_index] - 128) * ch1_scaling_factor;
             channel_values_index++;
         }
         if (ch2_on) {
             //channel_values[channel_values_index] = (ch2_data_offset[i] - 128) * ch2_scaling_factor + ch2_vert_offset;
-            channel_values[channel_values_index] = (ch2_data_offset[i] - 128) * ch2_scaling_factor;
+            codes[channel_values_index] = ch2_data_offset[i];
+            channel_values[channel_values_index] = (codes[channel_values_index] - 128) * ch2_scaling_factor;
             channel_values_index++;
         }
         if (ch3_on) {
             //channel_values[channel_values_index] = (ch3_data_offset[i] - 128) * ch3_scaling_factor + ch3_vert_offset;
-            channel_values[channel_values_index] = (ch3_data_offset[i] - 128) * ch3_scaling_factor;
+            codes[channel_values_index] = ch3_data_offset[i];
+            channel_values[channel_values_index] = (codes[channel_values_index] - 128) * ch3_scaling_factor;
             channel_values_index++;
         }
         if (ch4_on) {
             //channel_values[channel_values_index] = (ch4_data_offset[i] - 128) * ch4_scaling_factor + ch4_vert_offset;
-            channel_values[channel_values_index] = (ch4_data_offset[i] - 128) * ch4_scaling_factor;
+            codes[channel_values_index] = ch4_data_offset[i];
+            channel_values[channel_values_index] = (codes[channel_values_index] - 128) * ch4_scaling_factor;
             channel_values_index++;
         }
 
@@ -131,8 +170,57 @@ void *conversion_thread(void *ptr) {
         output_pointer[csv_line_length - 1] = '\n';
 
         output_pointer += csv_line_length;
+
+        // Feed the statistics and preview sinks from the codes already loaded for the CSV line.
+        if (compute_statistics) {
+            for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+                int32_t centered_code = codes[channel] - 128;
+                if (codes[channel] < code_minimums[channel]) {
+                    code_minimums[channel] = codes[channel];
+                }
+                if (codes[channel] > code_maximums[channel]) {
+                    code_maximums[channel] = codes[channel];
+                }
+                code_sums[channel] += centered_code;
+                code_sums_of_squares[channel] += centered_code * centered_code;
+            }
+        }
+        if (preview_bucket_size) {
+            for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+                if (codes[channel] < bucket_minimums[channel]) {
+                    bucket_minimums[channel] = codes[channel];
+                }
+                if (codes[channel] > bucket_maximums[channel]) {
+                    bucket_maximums[channel] = codes[channel];
+                }
+            }
+            bucket_fill++;
+            if (bucket_fill == preview_bucket_size) {
+                for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+                    preview_minimums[bucket_index * enabled_analog_channels + channel] = bucket_minimums[channel];
+                    preview_maximums[bucket_index * enabled_analog_channels + channel] = bucket_maximums[channel];
+                    bucket_minimums[channel] = 255;
+                    bucket_maximums[channel] = 0;
+                }
+                bucket_fill = 0;
+                bucket_index++;
+            }
+        }
     }
 
+    // Only the last task can end partway through a preview bucket.
+    if (preview_bucket_size && bucket_fill > 0) {
+        for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+            preview_minimums[bucket_index * enabled_analog_channels + channel] = bucket_minimums[channel];
+            preview_maximums[bucket_index * enabled_analog_channels + channel] = bucket_maximums[channel];
+        }
+    }
+
+    memcpy(conversion_task->code_minimums, code_minimums, sizeof(code_minimums));
+    memcpy(conversion_task->code_maximums, code_maximums, sizeof(code_maximums));
+    memcpy(conversion_task->code_sums, code_sums, sizeof(code_sums));
+    memcpy(conversion_task->code_sums_of_squares, code_sums_of_squares, sizeof(code_sums_of_squares));
+
     return 0;
 }
 
@@ -157,6 +245,22 @@ void cleanup() {
         fclose(output_file);
         output_file = NULL;
     }
+    if (statistics_file) {
+        fclose(statistics_file);
+        statistics_file = NULL;
+    }
+    if (preview_file) {
+        fclose(preview_file);
+        preview_file = NULL;
+    }
+    if (preview_minimums) {
+        free(preview_minimums);
+        preview_minimums = NULL;
+    }
+    if (preview_maximums) {
+        free(preview_maximums);
+        preview_maximums = NULL;
+    }
 }
 
 const char *units_magnitude_prefixes[] = {"y", "z", "a", "f", "p", "n", "u", "m", "", "k", "M", "G", "T", "P"};
@@ -192,18 +296,29 @@ int main(int argc, char *argv[]) {
     // Parse arguments.
     char *input_filename;
     char *output_filename;
+    char *statistics_filename = NULL;
+    char *preview_filename = NULL;
     if (argc == 2) {
         input_filename = argv[1];
         output_filename = "csv_data.csv";
     }
-    else if (argc == 3) {
+    else if (argc >= 3 && argc <= 5) {
         input_filename = argv[1];
         output_filename = argv[2];
+        if (argc >= 4) {
+            statistics_filename = argv[3];
+        }
+        if (argc == 5) {
+            preview_filename = argv[4];
+        }
     }
     else {
-        fprintf(stderr, "Usage: ./siglent2csv usr_wf_data.bin csv_data.csv\n");
+        fprintf(stderr, "Usage: ./siglent2csv usr_wf_data.bin csv_data.csv [statistics.csv [preview.csv]]\n");
         fprintf(stderr, "    usr_wf_data.bin - .bin file of waveform data downloaded from the \"Waveform Save\" button on the oscilloscope's Web UI.\n");
         fprintf(stderr, "    csv_data.csv - destination filename\n");
+        fprintf(stderr, "    statistics.csv - optional destination for per-channel min/max/mean/RMS/standard deviation\n");
+        fprintf(stderr, "    preview.csv - optional destination for a %d-point min/max preview of each channel\n", PREVIEW_POINTS);
+        fprintf(stderr, "    The statistics and preview are computed in the same pass over the input as the CSV data.\n");
         return EXIT_FAILURE;
     }
 
@@ -385,6 +500,22 @@ int main(int argc, char *argv[]) {
         data_offset_counter += wave_length;
     }
 
+    // Per-enabled-channel lookup tables for the statistics and preview sinks.
+    uint8_t channel_numbers[4];
+    uint8_t channel_numbers_index = 0;
+    if (ch1_on) {
+        channel_numbers[channel_numbers_index++] = 1;
+    }
+    if (ch2_on) {
+        channel_numbers[channel_numbers_index++] = 2;
+    }
+    if (ch3_on) {
+        channel_numbers[channel_numbers_index++] = 3;
+    }
+    if (ch4_on) {
+        channel_numbers[channel_numbers_index++] = 4;
+    }
+
     const char *format_string;
     uint8_t csv_line_length;
     if (enabled_analog_channels == 0) {
@@ -414,6 +545,21 @@ int main(int argc, char *argv[]) {
     double ch3_scaling_factor = ch3_volt_div_val / unit_divider(ch3_volt_div_val_units_magnitude) / CODE_PER_DIV;
     double ch4_scaling_factor = ch4_volt_div_val / unit_divider(ch4_volt_div_val_units_magnitude) / CODE_PER_DIV;
 
+    double channel_scaling_factors[4];
+    uint8_t channel_scaling_factors_index = 0;
+    if (ch1_on) {
+        channel_scaling_factors[channel_scaling_factors_index++] = ch1_scaling_factor;
+    }
+    if (ch2_on) {
+        channel_scaling_factors[channel_scaling_factors_index++] = ch2_scaling_factor;
+    }
+    if (ch3_on) {
+        channel_scaling_factors[channel_scaling_factors_index++] = ch3_scaling_factor;
+    }
+    if (ch4_on) {
+        channel_scaling_factors[channel_scaling_factors_index++] = ch4_scaling_factor;
+    }
+
     double time_offset = -(time_div * 14.0 / 2.0);
     double time_scaling_factor = (1.0 / sample_rate);
 
@@ -421,6 +567,15 @@ int main(int argc, char *argv[]) {
     size_t output_file_buffer_length = wave_length * csv_line_length;
     char *output_pointer = output_file_buffer;
 
+    uint32_t preview_bucket_size = 0;
+    uint32_t preview_bucket_count = 0;
+    if (preview_filename && wave_length > 0) {
+        preview_bucket_size = (wave_length + PREVIEW_POINTS - 1) / PREVIEW_POINTS;
+        preview_bucket_count = (wave_length + preview_bucket_size - 1) / preview_bucket_size;
+        preview_minimums = malloc(preview_bucket_count * enabled_analog_channels);
+        preview_maximums = malloc(preview_bucket_count * enabled_analog_channels);
+    }
+
     //===========================================================================
     /*
     clock_t start = clock();
@@ -439,6 +594,10 @@ int main(int argc, char *argv[]) {
     struct timespec start, end;
     clock_gettime(CLOCK_REALTIME, &start);
     uint32_t maximum_task_size = wave_length / NUM_THREADS;
+    if (preview_bucket_size) {
+        // Round tasks up to a whole number of preview buckets so that no bucket is split between threads.
+        maximum_task_size = (maximum_task_size + preview_bucket_size - 1) / preview_bucket_size * preview_bucket_size;
+    }
     uint32_t start_index = 0;
     uint32_t task_size = 0;
     struct ConversionTask *previous_task = NULL;
@@ -477,6 +636,10 @@ int main(int argc, char *argv[]) {
         conversion_task->ch2_on = ch2_on;
         conversion_task->ch3_on = ch3_on;
         conversion_task->ch4_on = ch4_on;
+        conversion_task->compute_statistics = statistics_filename != NULL;
+        conversion_task->preview_bucket_size = preview_bucket_size;
+        conversion_task->preview_minimums = preview_minimums;
+        conversion_task->preview_maximums = preview_maximums;
         conversion_task->previous_task = previous_task;
 
         // Start conversion thread.
@@ -510,6 +673,89 @@ int main(int argc, char *argv[]) {
     time_used = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
     printf("CSV data write took %f seconds.\n", time_used);
 
+    if (statistics_filename) {
+        clock_gettime(CLOCK_REALTIME, &start);
+        // Merge the per-task statistics.
+        uint8_t code_minimums[4] = {255, 255, 255, 255};
+        uint8_t code_maximums[4] = {0, 0, 0, 0};
+        int64_t code_sums[4] = {0, 0, 0, 0};
+        uint64_t code_sums_of_squares[4] = {0, 0, 0, 0};
+        for (struct ConversionTask *task = previous_task; task; task = task->previous_task) {
+            for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+                if (task->code_minimums[channel] < code_minimums[channel]) {
+                    code_minimums[channel] = task->code_minimums[channel];
+                }
+                if (task->code_maximums[channel] > code_maximums[channel]) {
+                    code_maximums[channel] = task->code_maximums[channel];
+                }
+                code_sums[channel] += task->code_sums[channel];
+                code_sums_of_squares[channel] += task->code_sums_of_squares[channel];
+            }
+        }
+
+        statistics_file = fopen(statistics_filename, "w");
+        if (!statistics_file) {
+            fprintf(stderr, "Failed to open file %s for writing: %s\n", statistics_filename, strerror(errno));
+            cleanup();
+            return EXIT_FAILURE;
+        }
+        fprintf(statistics_file, "channel,samples,min,max,mean,rms,stddev\n");
+        for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+            double scaling_factor = channel_scaling_factors[channel];
+            double mean_code = (double) code_sums[channel] / wave_length;
+            double mean_square_code = (double) code_sums_of_squares[channel] / wave_length;
+            double variance_code = mean_square_code - mean_code * mean_code;
+            if (variance_code < 0.0) {
+                variance_code = 0.0;
+            }
+            double minimum = (code_minimums[channel] - 128) * scaling_factor;
+            double maximum = (code_maximums[channel] - 128) * scaling_factor;
+            if (minimum > maximum) {
+                double temp = minimum;
+                minimum = maximum;
+                maximum = temp;
+            }
+            fprintf(statistics_file, "CH%u,%u,%f,%f,%f,%f,%f\n", channel_numbers[channel], wave_length, minimum, maximum, mean_code * scaling_factor, sqrt(mean_square_code) * fabs(scaling_factor), sqrt(variance_code) * fabs(scaling_factor));
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        time_used = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+        printf("Statistics write took %f seconds.\n", time_used);
+    }
+
+    if (preview_filename) {
+        clock_gettime(CLOCK_REALTIME, &start);
+        preview_file = fopen(preview_filename, "w");
+        if (!preview_file) {
+            fprintf(stderr, "Failed to open file %s for writing: %s\n", preview_filename, strerror(errno));
+            cleanup();
+            return EXIT_FAILURE;
+        }
+        fprintf(preview_file, "time");
+        for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+            fprintf(preview_file, ",CH%u min,CH%u max", channel_numbers[channel], channel_numbers[channel]);
+        }
+        fprintf(preview_file, "\n");
+        for (uint32_t bucket = 0; bucket < preview_bucket_count; bucket++) {
+            // Timestamp of the first sample in the bucket, matching the timestamps in the CSV data.
+            fprintf(preview_file, "% .11f", time_offset + ((double) bucket * preview_bucket_size + 1) * time_scaling_factor);
+            for (uint8_t channel = 0; channel < enabled_analog_channels; channel++) {
+                double scaling_factor = channel_scaling_factors[channel];
+                double minimum = (preview_minimums[bucket * enabled_analog_channels + channel] - 128) * scaling_factor;
+                double maximum = (preview_maximums[bucket * enabled_analog_channels + channel] - 128) * scaling_factor;
+                if (minimum > maximum) {
+                    double temp = minimum;
+                    minimum = maximum;
+                    maximum = temp;
+                }
+                fprintf(preview_file, ",% 6f,% 6f", minimum, maximum);
+            }
+            fprintf(preview_file, "\n");
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        time_used = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+        printf("Preview write took %f seconds.\n", time_used);
+    }
+
     clock_gettime(CLOCK_REALTIME, &start);
     struct ConversionTask *task = previous_task;
     while (task != NULL) {